@@ -0,0 +1,94 @@
+#ifndef _ASYNC_H_
+#define _ASYNC_H_
+
+#include <optimizer.h>
+#include <threadpool.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+//! Handle to an optimization running on a ThreadPool. It can be polled for the best point so far,
+//! cancelled, or waited on.
+template <size_t Dimension, typename Value = double>
+class Optimization {
+  typedef typename Control<Dimension, Value>::Clock Clock;
+
+  Problem<Dimension, Value> _problem;
+  Control<Dimension, Value> _control;
+  typename Control<Dimension, Value>::Callback _callback;
+  mutable std::mutex _mutex;
+  std::condition_variable _finished;
+  Progress<Dimension, Value> _best;
+  uint64_t _seed;
+  bool _found, _done;
+
+  void update(const Progress<Dimension, Value>& progress) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _best = progress;
+      _found = true;
+    }
+    if (_callback) _callback(progress);
+  }
+
+public:
+  //! The problem is copied so its evaluation counters belong to this run alone.
+  Optimization( const Problem<Dimension, Value>& problem, uint64_t seed, typename Control<Dimension, Value>::Callback callback,
+                typename Clock::time_point deadline )
+    : _problem(problem), _control([this] (const Progress<Dimension, Value>& p) { update(p); }, deadline),
+      _callback(callback), _seed(seed), _found(false), _done(false) { }
+
+  void run(Optimizer<Dimension, Value>& optimizer) {
+    seedRandom(_seed);
+    _problem.reset();
+    auto result = optimizer.optimize(_problem, _control);
+    _control.improved(_problem, result, _problem.function(result));
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _done = true;
+    }
+    _finished.notify_all();
+  }
+
+  //! Stops the optimization at its next check; the best point so far stays available.
+  void cancel() { _control.cancel(); }
+
+  bool done() const { std::lock_guard<std::mutex> lock(_mutex); return _done; }
+
+  //! Copies the best point found so far into progress. Returns false if nothing has been found yet.
+  bool best(Progress<Dimension, Value>& progress) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_found) progress = _best;
+    return _found;
+  }
+
+  //! Blocks until the optimization has returned, then copies its best point into progress. Returns false
+  //! if no point within the bounds was ever found, leaving progress untouched.
+  bool wait(Progress<Dimension, Value>& progress) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _finished.wait(lock, [this] { return _done; });
+    if (_found) progress = _best;
+    return _found;
+  }
+};
+
+//! Starts optimizer on problem in pool and returns at once. The worker draws its random numbers from seed,
+//! so runs given distinct seeds explore differently and a seed reproduces a run that is not cut short.
+//! Improvements are streamed to callback from the worker thread, and the run stops cooperatively at
+//! deadline. The optimizer must outlive the run; optimizers keep no state while optimizing, so one can
+//! serve many concurrent runs.
+//!
+//! A run holds its worker until it stops, so at most pool.size() runs progress at once and the rest wait
+//! in submission order. The deadline counts from when it was set, not from when the run starts: a run
+//! still queued at its deadline returns at once with the single point it drew. Size the pool, or stagger
+//! the deadlines, for the number of runs that must all make progress.
+template <size_t Dimension, typename Value = double>
+std::shared_ptr<Optimization<Dimension, Value>> optimizeAsync(ThreadPool& pool, Optimizer<Dimension, Value>& optimizer,
+    const Problem<Dimension, Value>& problem, uint64_t seed, typename Control<Dimension, Value>::Callback callback = nullptr,
+    typename Control<Dimension, Value>::Clock::time_point deadline = Control<Dimension, Value>::Clock::time_point::max()) {
+  auto run = std::make_shared<Optimization<Dimension, Value>>(problem, seed, callback, deadline);
+  pool.submit([run, &optimizer] { run->run(optimizer); });
+  return run;
+}
+
+#endif
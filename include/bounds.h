@@ -2,10 +2,30 @@
 #define _BOUNDS_H_
 
 #include <vector.h>
+#include <interval.h>
+#include <atomic>
 #include <iostream>
+#include <random>
 
-double randDouble() { return (double)rand() / RAND_MAX; }
-size_t randInt( size_t max ) { size_t mm = RAND_MAX / max * max; size_t tmp; do { tmp = rand(); } while( tmp >= mm ); return tmp % max; }
+//! A seed unlike any other this process has drawn: entropy from the system, mixed with a counter in case
+//! the system has none to give.
+inline uint64_t randomSeed() {
+  static std::atomic<uint64_t> drawn(0);
+  std::random_device device;
+  uint64_t n = drawn++;
+  std::seed_seq seq{ device(), device(), (unsigned)n, (unsigned)(n >> 32) };
+  uint32_t out[2];
+  seq.generate( out, out + 2 );
+  return (uint64_t)out[0] << 32 | out[1];
+}
+
+//! Each thread draws from its own engine, seeded uniquely, so concurrent optimizations neither contend
+//! nor share a sequence. seedRandom makes the calling thread's draws reproducible.
+inline std::mt19937_64& randomEngine() { thread_local std::mt19937_64 engine( randomSeed() ); return engine; }
+inline void seedRandom( uint64_t seed ) { randomEngine().seed( seed ); }
+
+inline double randDouble() { return std::uniform_real_distribution<double>( 0, 1 )( randomEngine() ); }
+inline size_t randInt( size_t max ) { return std::uniform_int_distribution<size_t>( 0, max - 1 )( randomEngine() ); }
 
 template <size_t Dimension, typename Value = double>
 class Bounds {
@@ -24,6 +44,16 @@ public:
     : _minimum(minimum), _maximum(maximum) {
   }
 
+  const Vector<Dimension, Value> &minimum() const { return _minimum; }
+  const Vector<Dimension, Value> &maximum() const { return _maximum; }
+
+  //! The bounds as a box of variable ranges.
+  inline IntervalVector<Dimension, Value> box() const {
+    IntervalVector<Dimension, Value> b;
+    for (size_t idx = 0; idx < Dimension; idx++) b[idx] = Interval<Value>(_minimum[idx], _maximum[idx]);
+    return b;
+  }
+
   //! Tests if a vector is in the valid range specified by the bounds.
   inline bool valid(const Vector<Dimension, Value> &v) const {
     for (size_t idx = 0; idx < Dimension; idx++) {
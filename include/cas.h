@@ -2,16 +2,40 @@
 #define __CAS_H_
 
 #include "vector.h"
+#include "interval.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
 //#define assertR(a) assert( !isnan(a) ); return a;
 #define assertR(a) return a;
 
+//! Operations of the flattened (postfix) form of an Expression graph.
+enum class OpCode : uint32_t {
+  CONST, VAR, ADD, SUB, MUL, DIV, NEG, COS, SIN, EXP, LOG, SQRT, SQUARE
+};
+
+//! One step of a compiled Expression. Fixed layout so arrays of these can be written to disk and mapped back in.
+struct Instruction {
+  OpCode op;
+  uint32_t arg;
+  double val;
+};
+
 template< size_t L=3, typename V=double >
 class Expression { 
 public:
-  virtual V eval( const Vector<L,V> vals) const = 0;
-  virtual Vector<L,V> grad( const Vector<L,V> vals) const = 0;
-  inline V operator() (const Vector<L,V> vals) const { assertR( eval(vals) ) }
+  virtual V eval( const Vector<L,V>& vals) const = 0;
+  virtual Vector<L,V> grad( const Vector<L,V>& vals) const = 0;
+  //! The derivative with respect to variable idx alone.
+  virtual V partial( const Vector<L,V>& vals, size_t idx ) const = 0;
+  //! Appends the signed terms of this expression read as a sum; anything but +, - and negation is one term.
+  virtual void terms( std::vector<std::pair<const Expression<L,V>*, V>>& out, V sign ) const { out.push_back({this, sign}); }
+  //! Bounds the values taken over a box of variable ranges.
+  virtual Interval<V> range( const IntervalVector<L,V>& box ) const = 0;
+  //! Appends the postfix instructions computing this expression to code.
+  virtual void compile( std::vector<Instruction>& code ) const = 0;
+  inline V operator() (const Vector<L,V>& vals) const { assertR( eval(vals) ) }
 };
 
 template< size_t L=3, typename V=double >
@@ -20,8 +44,11 @@ V _val;
 public:
   ConstExpression( const V& val ) : _val(val) {}
   ConstExpression( const V&& val ) : _val(val) {}
-  V eval( const Vector<L,V> vals) const override final { assertR( _val ) }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return Vector<L,V>::Zero(); }
+  V eval( const Vector<L,V>& vals) const override final { assertR( _val ) }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return Vector<L,V>::Zero(); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { return 0; }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return Interval<V>(_val); }
+  void compile( std::vector<Instruction>& code ) const override final { code.push_back({OpCode::CONST, 0, (double)_val}); }
 };
 
 template< size_t L=3, typename V=double >
@@ -30,8 +57,11 @@ size_t _idx;
 public:
   VarExpression( const size_t& idx ) : _idx(idx) {}
   VarExpression( const size_t&& idx ) : _idx(idx) {}
-  V eval( const Vector<L,V> vals) const override final { assertR( vals[_idx] ) }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return Vector<L,V>(_idx, 1); }
+  V eval( const Vector<L,V>& vals) const override final { assertR( vals[_idx] ) }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return Vector<L,V>(_idx, 1); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { return idx == _idx ? 1 : 0; }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return box[_idx]; }
+  void compile( std::vector<Instruction>& code ) const override final { code.push_back({OpCode::VAR, (uint32_t)_idx, 0}); }
 };
 
 template< char op, size_t L=3, typename V=double >
@@ -39,8 +69,11 @@ class EBinop : public Expression<L,V> {
   const Expression<L,V> &left;
   const Expression<L,V> &right;
 public:
-  V eval( const Vector<L,V> vals ) const override final;
-  Vector<L,V> grad( const Vector<L,V> vals) const override final;
+  V eval( const Vector<L,V>& vals ) const override final;
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final;
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final;
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final;
+  void compile( std::vector<Instruction>& code ) const override final;
 };
 
 
@@ -51,8 +84,14 @@ class EBinop<'+', L, V> : public Expression<L,V> {
 public:
   EBinop( const Expression<L,V>& lhs, const Expression<L,V>& rhs ) : left(lhs), right(rhs) {}
   EBinop( const Expression<L,V>&& lhs, const Expression<L,V>&& rhs ) : left(lhs), right(rhs) {}
-  V eval( const Vector<L,V> vals ) const { return left.eval(vals) + right.eval(vals); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return left.grad(vals) + right.grad(vals); }
+  V eval( const Vector<L,V>& vals ) const { return left.eval(vals) + right.eval(vals); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return left.grad(vals) + right.grad(vals); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { return left.partial(vals, idx) + right.partial(vals, idx); }
+  void terms( std::vector<std::pair<const Expression<L,V>*, V>>& out, V sign ) const override final { left.terms(out, sign); right.terms(out, sign); }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return left.range(box) + right.range(box); }
+  void compile( std::vector<Instruction>& code ) const override final {
+    left.compile(code); right.compile(code); code.push_back({OpCode::ADD, 0, 0});
+  }
 };
 
 template< size_t L, typename V > 
@@ -62,8 +101,14 @@ class EBinop<'-', L, V> : public Expression<L,V> {
 public:
   EBinop( const Expression<L,V>& lhs, const Expression<L,V>& rhs ) : left(lhs), right(rhs) {}
   EBinop( const Expression<L,V>&& lhs, const Expression<L,V>&& rhs ) : left(lhs), right(rhs) {}
-  V eval( const Vector<L,V> vals ) const { return left.eval(vals) - right.eval(vals); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return left.grad(vals) - right.grad(vals); }
+  V eval( const Vector<L,V>& vals ) const { return left.eval(vals) - right.eval(vals); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return left.grad(vals) - right.grad(vals); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { return left.partial(vals, idx) - right.partial(vals, idx); }
+  void terms( std::vector<std::pair<const Expression<L,V>*, V>>& out, V sign ) const override final { left.terms(out, sign); right.terms(out, -sign); }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return left.range(box) - right.range(box); }
+  void compile( std::vector<Instruction>& code ) const override final {
+    left.compile(code); right.compile(code); code.push_back({OpCode::SUB, 0, 0});
+  }
 };
 
 template< size_t L, typename V > 
@@ -73,8 +118,30 @@ class EBinop<'*', L, V> : public Expression<L,V> {
 public:
   EBinop( const Expression<L,V>& lhs, const Expression<L,V>& rhs ) : left(lhs), right(rhs) {}
   EBinop( const Expression<L,V>&& lhs, const Expression<L,V>&& rhs ) : left(lhs), right(rhs) {}
-  V eval( const Vector<L,V> vals ) const { return left.eval(vals) * right.eval(vals); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return left.grad(vals) * right.eval(vals) + left.eval(vals) * right.grad(vals); }
+  V eval( const Vector<L,V>& vals ) const {
+    if( &left == &right ) { V l = left.eval(vals); return l * l; }
+    return left.eval(vals) * right.eval(vals);
+  }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final {
+    if( &left == &right ) return 2 * left.eval(vals) * left.grad(vals);
+    return left.grad(vals) * right.eval(vals) + left.eval(vals) * right.grad(vals);
+  }
+  //! Factors are only evaluated when the other factor's partial is nonzero; both are still walked for their partials.
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final {
+    V lp = left.partial(vals, idx);
+    if( &left == &right ) return lp == 0 ? 0 : 2 * left.eval(vals) * lp;
+    V rp = right.partial(vals, idx);
+    return ( lp == 0 ? 0 : lp * right.eval(vals) ) + ( rp == 0 ? 0 : left.eval(vals) * rp );
+  }
+  //! A node multiplied by itself (as abs and integer powers are built) is a square, which tightens its range.
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final {
+    if( &left == &right ) return square( left.range(box) );
+    return left.range(box) * right.range(box);
+  }
+  void compile( std::vector<Instruction>& code ) const override final {
+    if( &left == &right ) { left.compile(code); code.push_back({OpCode::SQUARE, 0, 0}); return; }
+    left.compile(code); right.compile(code); code.push_back({OpCode::MUL, 0, 0});
+  }
 };
 
 template< size_t L, typename V > 
@@ -84,10 +151,20 @@ class EBinop<'/', L, V> : public Expression<L,V> {
 public:
   EBinop( const Expression<L,V>& lhs, const Expression<L,V>& rhs ) : left(lhs), right(rhs) {}
   EBinop( const Expression<L,V>&& lhs, const Expression<L,V>&& rhs ) : left(lhs), right(rhs) {}
-  V eval( const Vector<L,V> vals ) const { return left.eval(vals) / right.eval(vals); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { 
+  V eval( const Vector<L,V>& vals ) const { return left.eval(vals) / right.eval(vals); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { 
     auto g = right.eval(vals);
 return ( left.grad(vals) * g - left.eval(vals) * right.grad(vals) ) / ( g*g ); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final {
+    V lp = left.partial(vals, idx), rp = right.partial(vals, idx);
+    if( lp == 0 && rp == 0 ) return 0;
+    auto g = right.eval(vals);
+    return ( lp * g - ( rp == 0 ? 0 : left.eval(vals) * rp ) ) / ( g*g );
+  }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return left.range(box) / right.range(box); }
+  void compile( std::vector<Instruction>& code ) const override final {
+    left.compile(code); right.compile(code); code.push_back({OpCode::DIV, 0, 0});
+  }
 };
 
 /*
@@ -98,8 +175,8 @@ class EBinop<'^', L, V> : public Expression<L,V> {
 public:
   EBinop( const Expression<L,V>& lhs, const Expression<L,V>& rhs ) : left(lhs), right(rhs) {}
   EBinop( const Expression<L,V>&& lhs, const Expression<L,V>&& rhs ) : left(lhs), right(rhs) {}
-  V eval( const Vector<L,V> vals ) const { return pow(left.eval(vals), right.eval(vals)); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return left.grad(vals) * right.eval(vals) + left.eval(vals) * right.grad(vals); }
+  V eval( const Vector<L,V>& vals ) const { return pow(left.eval(vals), right.eval(vals)); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return left.grad(vals) * right.eval(vals) + left.eval(vals) * right.grad(vals); }
 };*/
 
 template< size_t L, typename V=double > 
@@ -243,7 +320,10 @@ class EFunc : public Expression<L,V> {
 public:
   EFunc( const Expression<L,V>& innerA ) : inner(innerA) {}
   EFunc( const Expression<L,V>&& innerA ) : inner(innerA) {}
-  V eval( const Vector<L,V> vals ) const override final;
+  V eval( const Vector<L,V>& vals ) const override final;
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final;
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final;
+  void compile( std::vector<Instruction>& code ) const override final;
 };
 
 template< size_t L, typename V > 
@@ -252,8 +332,12 @@ class EFunc<SymFunction::NEG,L,V> : public Expression<L,V> {
 public:
   EFunc( const Expression<L,V>& innerA ) : inner(innerA) {}
   EFunc( const Expression<L,V>&& innerA ) : inner(innerA) {}
-  V eval( const Vector<L,V> vals ) const { return -( inner.eval(vals) ); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return - inner.grad(vals); }
+  V eval( const Vector<L,V>& vals ) const { return -( inner.eval(vals) ); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return - inner.grad(vals); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { return -inner.partial(vals, idx); }
+  void terms( std::vector<std::pair<const Expression<L,V>*, V>>& out, V sign ) const override final { inner.terms(out, -sign); }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return -( inner.range(box) ); }
+  void compile( std::vector<Instruction>& code ) const override final { inner.compile(code); code.push_back({OpCode::NEG, 0, 0}); }
 };
 
 template< size_t L, typename V > 
@@ -262,8 +346,11 @@ class EFunc<SymFunction::COS,L,V> : public Expression<L,V> {
 public:
   EFunc( const Expression<L,V>& innerA ) : inner(innerA) {}
   EFunc( const Expression<L,V>&& innerA ) : inner(innerA) {}
-  V eval( const Vector<L,V> vals ) const { return cos( inner.eval(vals) ); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return -sin(inner.eval(vals))*inner.grad(vals); }
+  V eval( const Vector<L,V>& vals ) const { return cos( inner.eval(vals) ); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return -sin(inner.eval(vals))*inner.grad(vals); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { V p = inner.partial(vals, idx); return p == 0 ? 0 : -sin(inner.eval(vals))*p; }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return cos( inner.range(box) ); }
+  void compile( std::vector<Instruction>& code ) const override final { inner.compile(code); code.push_back({OpCode::COS, 0, 0}); }
 };
 
 template< size_t L, typename V > 
@@ -272,8 +359,11 @@ class EFunc<SymFunction::SIN,L,V> : public Expression<L,V> {
 public:
   EFunc( const Expression<L,V>& innerA ) : inner(innerA) {}
   EFunc( const Expression<L,V>&& innerA ) : inner(innerA) {}
-  V eval( const Vector<L,V> vals ) const { return sin( inner.eval(vals) ); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return cos(inner.eval(vals))*inner.grad(vals); }
+  V eval( const Vector<L,V>& vals ) const { return sin( inner.eval(vals) ); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return cos(inner.eval(vals))*inner.grad(vals); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { V p = inner.partial(vals, idx); return p == 0 ? 0 : cos(inner.eval(vals))*p; }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return sin( inner.range(box) ); }
+  void compile( std::vector<Instruction>& code ) const override final { inner.compile(code); code.push_back({OpCode::SIN, 0, 0}); }
 };
 
 template< size_t L, typename V > 
@@ -282,8 +372,11 @@ class EFunc<SymFunction::EXP,L,V> : public Expression<L,V> {
 public:
   EFunc( const Expression<L,V>& innerA ) : inner(innerA) {}
   EFunc( const Expression<L,V>&& innerA ) : inner(innerA) {}
-  V eval( const Vector<L,V> vals ) const { assertR( exp( inner.eval(vals) ) ); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return exp(inner.eval(vals))*inner.grad(vals); }
+  V eval( const Vector<L,V>& vals ) const { assertR( exp( inner.eval(vals) ) ); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return exp(inner.eval(vals))*inner.grad(vals); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { V p = inner.partial(vals, idx); return p == 0 ? 0 : exp(inner.eval(vals))*p; }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return exp( inner.range(box) ); }
+  void compile( std::vector<Instruction>& code ) const override final { inner.compile(code); code.push_back({OpCode::EXP, 0, 0}); }
 };
 
 template< size_t L, typename V > 
@@ -292,8 +385,11 @@ class EFunc<SymFunction::LOG,L,V> : public Expression<L,V> {
 public:
   EFunc( const Expression<L,V>& innerA ) : inner(innerA) {}
   EFunc( const Expression<L,V>&& innerA ) : inner(innerA) {}
-  V eval( const Vector<L,V> vals ) const { assertR( log( inner.eval(vals) ) ); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return inner.grad(vals)/inner.eval(vals); }
+  V eval( const Vector<L,V>& vals ) const { assertR( log( inner.eval(vals) ) ); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return inner.grad(vals)/inner.eval(vals); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { V p = inner.partial(vals, idx); return p == 0 ? 0 : p/inner.eval(vals); }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return log( inner.range(box) ); }
+  void compile( std::vector<Instruction>& code ) const override final { inner.compile(code); code.push_back({OpCode::LOG, 0, 0}); }
 };
 
 template< size_t L, typename V > 
@@ -302,8 +398,11 @@ class EFunc<SymFunction::SQRT,L,V> : public Expression<L,V> {
 public:
   EFunc( const Expression<L,V>& innerA ) : inner(innerA) {}
   EFunc( const Expression<L,V>&& innerA ) : inner(innerA) {}
-  V eval( const Vector<L,V> vals ) const { assertR( sqrt( inner.eval(vals) ) ); }
-  Vector<L,V> grad( const Vector<L,V> vals) const override final { return inner.grad(vals)/(2*sqrt(inner.eval(vals))); }
+  V eval( const Vector<L,V>& vals ) const { assertR( sqrt( inner.eval(vals) ) ); }
+  Vector<L,V> grad( const Vector<L,V>& vals) const override final { return inner.grad(vals)/(2*sqrt(inner.eval(vals))); }
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final { V p = inner.partial(vals, idx); return p == 0 ? 0 : p/(2*sqrt(inner.eval(vals))); }
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final { return sqrt( inner.range(box) ); }
+  void compile( std::vector<Instruction>& code ) const override final { inner.compile(code); code.push_back({OpCode::SQRT, 0, 0}); }
 };
 
 template< size_t L, typename V > 
@@ -340,4 +439,65 @@ template< size_t L, typename V >
 const Expression<L,V>& abs( const Expression<L,V>& val ) {
   return sqrt(val*val);
 }
+/*
+ An expression read as a sum of terms, each recorded with the variables it depends on. Derivatives
+ then only visit the terms touching a variable, and each term only for the variables in its support,
+ so for terms of bounded size they cost time linear in the number of terms instead of in nodes times
+ dimension.
+*/
+template< size_t L=3, typename V=double >
+class Separable {
+public:
+  struct Term {
+    const Expression<L,V>* expr;
+    V sign;
+    std::vector<uint32_t> support;
+  };
+  //! Nonzero entries of a gradient as (variable, derivative) pairs.
+  typedef std::vector<std::pair<uint32_t, V>> SparseGradient;
+private:
+  std::vector<Term> _terms;
+  std::vector<std::vector<uint32_t>> _touching;
+public:
+  Separable( const Expression<L,V>& expr ) : _touching(L) {
+    std::vector<std::pair<const Expression<L,V>*, V>> terms;
+    expr.terms(terms, 1);
+    std::vector<Instruction> code;
+    for( auto& t : terms ) {
+      code.clear();
+      t.first->compile(code);
+      Term term = { t.first, t.second, {} };
+      for( auto& in : code ) if( in.op == OpCode::VAR ) term.support.push_back(in.arg);
+      std::sort( term.support.begin(), term.support.end() );
+      term.support.erase( std::unique( term.support.begin(), term.support.end() ), term.support.end() );
+      for( auto idx : term.support ) _touching[idx].push_back(_terms.size());
+      _terms.push_back(term);
+    }
+  }
+
+  size_t size() const { return _terms.size(); }
+  const Term& term( size_t t ) const { return _terms[t]; }
+
+  V eval( const Vector<L,V>& vals, size_t t ) const { return _terms[t].sign * _terms[t].expr->eval(vals); }
+
+  V partial( const Vector<L,V>& vals, size_t idx ) const {
+    V sum = 0;
+    for( auto t : _touching[idx] ) sum += _terms[t].sign * _terms[t].expr->partial(vals, idx);
+    return sum;
+  }
+
+  //! Replaces out with the gradient of term t, which is nonzero only on the term's support.
+  void grad( const Vector<L,V>& vals, size_t t, SparseGradient& out ) const {
+    out.clear();
+    for( auto idx : _terms[t].support ) out.push_back({ idx, _terms[t].sign * _terms[t].expr->partial(vals, idx) });
+  }
+
+  //! The full gradient, assembled term by term over their supports.
+  Vector<L,V> grad( const Vector<L,V>& vals ) const {
+    Vector<L,V> g = Vector<L,V>::Zero();
+    for( auto& term : _terms )
+      for( auto idx : term.support ) g[idx] += term.sign * term.expr->partial(vals, idx);
+    return g;
+  }
+};
 #endif
@@ -0,0 +1,312 @@
+#ifndef __COMPILED_H_
+#define __COMPILED_H_
+
+#include <cas.h>
+#include <problem.h>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//! Deepest evaluation stack a compiled expression may need.
+static const size_t MaxStackDepth = 64;
+
+//! Returns the stack depth needed to run code, or 0 if it is not a well formed program over dimension variables.
+inline size_t stackDepth( const Instruction* code, size_t length, size_t dimension ) {
+  size_t depth = 0, maxDepth = 0;
+  for( size_t i = 0; i < length; i++ ) {
+    switch( code[i].op ) {
+      case OpCode::CONST: depth++; break;
+      case OpCode::VAR:
+        if( code[i].arg >= dimension ) return 0;
+        depth++;
+        break;
+      case OpCode::ADD: case OpCode::SUB: case OpCode::MUL: case OpCode::DIV:
+        if( depth < 2 ) return 0;
+        depth--;
+        break;
+      case OpCode::NEG: case OpCode::COS: case OpCode::SIN:
+      case OpCode::EXP: case OpCode::LOG: case OpCode::SQRT: case OpCode::SQUARE:
+        if( depth < 1 ) return 0;
+        break;
+      default: return 0;
+    }
+    if( depth > maxDepth ) maxDepth = depth;
+  }
+  return depth == 1 ? maxDepth : 0;
+}
+
+//! An Expression evaluated from a flat array of instructions it does not own (e.g. a mapped file).
+template< size_t L=3, typename V=double >
+class CompiledExpression : public Expression<L,V> {
+  const Instruction* _code;
+  size_t _length;
+public:
+  CompiledExpression( const Instruction* code, size_t length ) : _code(code), _length(length) {
+    assert( stackDepth( code, length, L ) != 0 && stackDepth( code, length, L ) <= MaxStackDepth );
+  }
+
+  V eval( const Vector<L,V>& vals ) const override final {
+    V stack[MaxStackDepth];
+    size_t top = 0;
+    for( const Instruction* in = _code; in != _code + _length; in++ ) {
+      switch( in->op ) {
+        case OpCode::CONST: stack[top++] = in->val; break;
+        case OpCode::VAR: stack[top++] = vals[in->arg]; break;
+        case OpCode::ADD: top--; stack[top-1] += stack[top]; break;
+        case OpCode::SUB: top--; stack[top-1] -= stack[top]; break;
+        case OpCode::MUL: top--; stack[top-1] *= stack[top]; break;
+        case OpCode::DIV: top--; stack[top-1] /= stack[top]; break;
+        case OpCode::NEG: stack[top-1] = -stack[top-1]; break;
+        case OpCode::COS: stack[top-1] = cos( stack[top-1] ); break;
+        case OpCode::SIN: stack[top-1] = sin( stack[top-1] ); break;
+        case OpCode::EXP: stack[top-1] = exp( stack[top-1] ); break;
+        case OpCode::LOG: stack[top-1] = log( stack[top-1] ); break;
+        case OpCode::SQRT: stack[top-1] = sqrt( stack[top-1] ); break;
+        case OpCode::SQUARE: stack[top-1] *= stack[top-1]; break;
+        default: break;
+      }
+    }
+    assertR( stack[0] );
+  }
+
+  //! Forward mode differentiation, carrying a gradient alongside every stack slot.
+  Vector<L,V> grad( const Vector<L,V>& vals ) const override final {
+    V stack[MaxStackDepth];
+    Eigen::Matrix<V,L,1> dstack[MaxStackDepth];
+    size_t top = 0;
+    for( const Instruction* in = _code; in != _code + _length; in++ ) {
+      if( in->op == OpCode::CONST ) { stack[top] = in->val; dstack[top].setZero(); top++; continue; }
+      if( in->op == OpCode::VAR ) { stack[top] = vals[in->arg]; dstack[top] = Vector<L,V>(in->arg, 1); top++; continue; }
+      V& a = stack[top-1];
+      Eigen::Matrix<V,L,1>& da = dstack[top-1];
+      switch( in->op ) {
+        case OpCode::ADD: stack[top-2] += a; dstack[top-2] += da; top--; break;
+        case OpCode::SUB: stack[top-2] -= a; dstack[top-2] -= da; top--; break;
+        case OpCode::MUL:
+          dstack[top-2] = dstack[top-2] * a + stack[top-2] * da;
+          stack[top-2] *= a; top--; break;
+        case OpCode::DIV:
+          dstack[top-2] = ( dstack[top-2] * a - stack[top-2] * da ) / ( a*a );
+          stack[top-2] /= a; top--; break;
+        case OpCode::NEG: a = -a; da = -da; break;
+        case OpCode::COS: da *= -sin(a); a = cos(a); break;
+        case OpCode::SIN: da *= cos(a); a = sin(a); break;
+        case OpCode::EXP: a = exp(a); da *= a; break;
+        case OpCode::LOG: da /= a; a = log(a); break;
+        case OpCode::SQRT: a = sqrt(a); da /= 2*a; break;
+        case OpCode::SQUARE: da *= 2*a; a *= a; break;
+        default: break;
+      }
+    }
+    return dstack[0];
+  }
+
+  //! Forward mode differentiation along one variable, carrying a single tangent per stack slot.
+  V partial( const Vector<L,V>& vals, size_t idx ) const override final {
+    V stack[MaxStackDepth], dstack[MaxStackDepth];
+    size_t top = 0;
+    for( const Instruction* in = _code; in != _code + _length; in++ ) {
+      if( in->op == OpCode::CONST ) { stack[top] = in->val; dstack[top] = 0; top++; continue; }
+      if( in->op == OpCode::VAR ) { stack[top] = vals[in->arg]; dstack[top] = in->arg == idx ? 1 : 0; top++; continue; }
+      V& a = stack[top-1];
+      V& da = dstack[top-1];
+      switch( in->op ) {
+        case OpCode::ADD: stack[top-2] += a; dstack[top-2] += da; top--; break;
+        case OpCode::SUB: stack[top-2] -= a; dstack[top-2] -= da; top--; break;
+        case OpCode::MUL:
+          dstack[top-2] = dstack[top-2] * a + stack[top-2] * da;
+          stack[top-2] *= a; top--; break;
+        case OpCode::DIV:
+          dstack[top-2] = ( dstack[top-2] * a - stack[top-2] * da ) / ( a*a );
+          stack[top-2] /= a; top--; break;
+        case OpCode::NEG: a = -a; da = -da; break;
+        case OpCode::COS: da *= -sin(a); a = cos(a); break;
+        case OpCode::SIN: da *= cos(a); a = sin(a); break;
+        case OpCode::EXP: a = exp(a); da *= a; break;
+        case OpCode::LOG: da /= a; a = log(a); break;
+        case OpCode::SQRT: a = sqrt(a); da /= 2*a; break;
+        case OpCode::SQUARE: da *= 2*a; a *= a; break;
+        default: break;
+      }
+    }
+    return dstack[0];
+  }
+
+  Interval<V> range( const IntervalVector<L,V>& box ) const override final {
+    Interval<V> stack[MaxStackDepth];
+    size_t top = 0;
+    for( const Instruction* in = _code; in != _code + _length; in++ ) {
+      switch( in->op ) {
+        case OpCode::CONST: stack[top++] = Interval<V>( in->val ); break;
+        case OpCode::VAR: stack[top++] = box[in->arg]; break;
+        case OpCode::ADD: top--; stack[top-1] = stack[top-1] + stack[top]; break;
+        case OpCode::SUB: top--; stack[top-1] = stack[top-1] - stack[top]; break;
+        case OpCode::MUL: top--; stack[top-1] = stack[top-1] * stack[top]; break;
+        case OpCode::DIV: top--; stack[top-1] = stack[top-1] / stack[top]; break;
+        case OpCode::NEG: stack[top-1] = -stack[top-1]; break;
+        case OpCode::COS: stack[top-1] = cos( stack[top-1] ); break;
+        case OpCode::SIN: stack[top-1] = sin( stack[top-1] ); break;
+        case OpCode::EXP: stack[top-1] = exp( stack[top-1] ); break;
+        case OpCode::LOG: stack[top-1] = log( stack[top-1] ); break;
+        case OpCode::SQRT: stack[top-1] = sqrt( stack[top-1] ); break;
+        case OpCode::SQUARE: stack[top-1] = square( stack[top-1] ); break;
+        default: break;
+      }
+    }
+    return stack[0];
+  }
+
+  void compile( std::vector<Instruction>& code ) const override final {
+    code.insert( code.end(), _code, _code + _length );
+  }
+};
+
+/*
+ Binary problem library layout. All offsets are in bytes from the start of the file and 8 byte aligned.
+
+   LibraryHeader
+   ObjectiveRecord[count]
+   per record: double minimum[dimension], double maximum[dimension]
+   per record: Instruction code[length]
+*/
+static const char LibraryMagic[4] = { 'O', 'P', 'T', 'B' };
+static const uint32_t LibraryVersion = 1;
+
+struct LibraryHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct ObjectiveRecord {
+  char name[64];
+  double optimal;
+  uint32_t dimension;
+  uint32_t length;
+  uint64_t bounds;
+  uint64_t code;
+};
+
+//! Tests if the file at path starts with the binary library magic.
+inline bool isProblemLibrary( const std::string& path ) {
+  char magic[4] = { 0 };
+  std::ifstream in( path, std::ios::binary );
+  in.read( magic, sizeof(magic) );
+  return in && memcmp( magic, LibraryMagic, sizeof(magic) ) == 0;
+}
+
+//! Compiles the problems and writes them to path as a binary library.
+template< size_t L, typename V >
+void writeProblemLibrary( const std::string& path, const std::vector<Problem<L,V>>& problems ) {
+  std::vector<std::vector<Instruction>> codes( problems.size() );
+  for( size_t i = 0; i < problems.size(); i++ ) {
+    problems[i].expression().compile( codes[i] );
+    if( stackDepth( codes[i].data(), codes[i].size(), L ) > MaxStackDepth )
+      throw std::runtime_error( "expression too deep to compile: " + problems[i]._name );
+  }
+
+  LibraryHeader header = { { 0 }, LibraryVersion, (uint32_t)problems.size(), 0 };
+  memcpy( header.magic, LibraryMagic, sizeof(LibraryMagic) );
+  std::vector<ObjectiveRecord> records( problems.size() );
+  uint64_t offset = sizeof(LibraryHeader) + records.size() * sizeof(ObjectiveRecord);
+  for( size_t i = 0; i < problems.size(); i++ ) {
+    memset( &records[i], 0, sizeof(ObjectiveRecord) );
+    strncpy( records[i].name, problems[i]._name.c_str(), sizeof(records[i].name) - 1 );
+    records[i].optimal = problems[i]._optimal;
+    records[i].dimension = L;
+    records[i].length = codes[i].size();
+    records[i].bounds = offset;
+    offset += 2 * L * sizeof(double);
+  }
+  for( size_t i = 0; i < problems.size(); i++ ) {
+    records[i].code = offset;
+    offset += codes[i].size() * sizeof(Instruction);
+  }
+
+  std::ofstream out( path, std::ios::binary | std::ios::trunc );
+  out.write( (const char*)&header, sizeof(header) );
+  out.write( (const char*)records.data(), records.size() * sizeof(ObjectiveRecord) );
+  for( auto& p : problems ) {
+    double bounds[2*L];
+    for( size_t d = 0; d < L; d++ ) {
+      bounds[d] = p.bounds().minimum()[d];
+      bounds[L+d] = p.bounds().maximum()[d];
+    }
+    out.write( (const char*)bounds, sizeof(bounds) );
+  }
+  for( auto& code : codes ) out.write( (const char*)code.data(), code.size() * sizeof(Instruction) );
+  if( !out ) throw std::runtime_error( "could not write problem library: " + path );
+}
+
+//! Problems of dimension L memory mapped from a binary library. Expressions run directly off the mapping.
+template< size_t L, typename V=double >
+class ProblemLibrary {
+  void* _data;
+  size_t _size;
+  std::vector<CompiledExpression<L,V>> _expressions;
+  std::vector<Problem<L,V>> _problems;
+
+  void fail( const std::string& path, const char* why ) {
+    if( _data != MAP_FAILED ) munmap( _data, _size );
+    throw std::runtime_error( "bad problem library " + path + ": " + why );
+  }
+public:
+  ProblemLibrary( const std::string& path ) : _data(MAP_FAILED), _size(0) {
+    int fd = open( path.c_str(), O_RDONLY );
+    if( fd < 0 ) fail( path, "cannot open" );
+    struct stat st;
+    if( fstat( fd, &st ) == 0 ) {
+      _size = st.st_size;
+      if( _size >= sizeof(LibraryHeader) ) _data = mmap( 0, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    }
+    close( fd );
+    if( _data == MAP_FAILED ) fail( path, "cannot map" );
+
+    const char* base = (const char*)_data;
+    const LibraryHeader& header = *(const LibraryHeader*)base;
+    if( memcmp( header.magic, LibraryMagic, sizeof(LibraryMagic) ) != 0 ) fail( path, "bad magic" );
+    if( header.version != LibraryVersion ) fail( path, "unsupported version" );
+    if( _size < sizeof(LibraryHeader) + (uint64_t)header.count * sizeof(ObjectiveRecord) ) fail( path, "truncated" );
+
+    const ObjectiveRecord* records = (const ObjectiveRecord*)( base + sizeof(LibraryHeader) );
+    // Offsets come from the file, so they are checked against the space left rather than summed.
+    uint64_t table = sizeof(LibraryHeader) + (uint64_t)header.count * sizeof(ObjectiveRecord);
+    auto fits = [&]( uint64_t offset, uint64_t bytes ) { return offset >= table && offset <= _size && bytes <= _size - offset; };
+    size_t matching = 0;
+    for( size_t i = 0; i < header.count; i++ ) if( records[i].dimension == L ) matching++;
+    _expressions.reserve( matching );
+    _problems.reserve( matching );
+
+    for( size_t i = 0; i < header.count; i++ ) {
+      const ObjectiveRecord& r = records[i];
+      if( r.dimension != L ) continue;
+      if( r.bounds % 8 || r.code % 8 || !fits( r.bounds, 2 * L * sizeof(double) )
+          || !fits( r.code, (uint64_t)r.length * sizeof(Instruction) ) ) fail( path, "record out of range" );
+      const Instruction* code = (const Instruction*)( base + r.code );
+      size_t depth = stackDepth( code, r.length, L );
+      if( depth == 0 || depth > MaxStackDepth ) fail( path, "malformed code" );
+
+      double lo[L], hi[L];
+      memcpy( lo, base + r.bounds, sizeof(lo) );
+      memcpy( hi, base + r.bounds + sizeof(lo), sizeof(hi) );
+      _expressions.emplace_back( code, r.length );
+      _problems.emplace_back( std::string( r.name, strnlen( r.name, sizeof(r.name) ) ), r.optimal,
+                              Bounds<L,V>( Vector<L,V>( lo ), Vector<L,V>( hi ) ), _expressions.back() );
+    }
+  }
+  ProblemLibrary( const ProblemLibrary& ) = delete;
+  ProblemLibrary& operator=( const ProblemLibrary& ) = delete;
+  ~ProblemLibrary() { munmap( _data, _size ); }
+
+  const std::vector<Problem<L,V>>& problems() const { return _problems; }
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef __INTERVAL_H_
+#define __INTERVAL_H_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+/*
+ Closed intervals [lo, hi] with inclusion functions for the operations of cas.h. Every result is
+ widened outward by one ulp per bound, so it contains the true range despite round to nearest
+ (and the within-an-ulp error of the libm functions).
+*/
+template< typename V=double >
+struct Interval {
+  V lo, hi;
+
+  Interval() : lo(0), hi(0) {}
+  Interval( V val ) : lo(val), hi(val) {}
+  Interval( V l, V h ) : lo(l), hi(h) {}
+
+  V mid() const { return lo + ( hi - lo ) / 2; }
+  V width() const { return hi - lo; }
+  bool contains( V val ) const { return lo <= val && val <= hi; }
+};
+
+template< size_t L, typename V=double >
+using IntervalVector = std::array<Interval<V>, L>;
+
+template< typename V > inline V roundDown( V val ) { return std::nextafter( val, -std::numeric_limits<V>::infinity() ); }
+template< typename V > inline V roundUp( V val ) { return std::nextafter( val, std::numeric_limits<V>::infinity() ); }
+template< typename V > inline Interval<V> outward( V lo, V hi ) { return Interval<V>( roundDown( lo ), roundUp( hi ) ); }
+
+//! Product where 0 * inf is 0, as the bound of a set product.
+template< typename V > inline V boundMul( V a, V b ) { return ( a == 0 || b == 0 ) ? 0 : a * b; }
+
+template< typename V >
+Interval<V> operator+( const Interval<V>& a, const Interval<V>& b ) { return outward( a.lo + b.lo, a.hi + b.hi ); }
+
+template< typename V >
+Interval<V> operator-( const Interval<V>& a, const Interval<V>& b ) { return outward( a.lo - b.hi, a.hi - b.lo ); }
+
+template< typename V >
+Interval<V> operator-( const Interval<V>& a ) { return Interval<V>( -a.hi, -a.lo ); }
+
+template< typename V >
+Interval<V> operator*( const Interval<V>& a, const Interval<V>& b ) {
+  V p[4] = { boundMul( a.lo, b.lo ), boundMul( a.lo, b.hi ), boundMul( a.hi, b.lo ), boundMul( a.hi, b.hi ) };
+  return outward( *std::min_element( p, p+4 ), *std::max_element( p, p+4 ) );
+}
+
+template< typename V >
+Interval<V> operator/( const Interval<V>& a, const Interval<V>& b ) {
+  if( b.contains( 0 ) ) return Interval<V>( -std::numeric_limits<V>::infinity(), std::numeric_limits<V>::infinity() );
+  return a * outward( 1 / b.hi, 1 / b.lo );
+}
+
+//! a*a, which unlike a product of two independent intervals is never negative.
+template< typename V >
+Interval<V> square( const Interval<V>& a ) {
+  if( a.lo >= 0 ) return Interval<V>( std::max( roundDown( a.lo * a.lo ), V(0) ), roundUp( a.hi * a.hi ) );
+  if( a.hi <= 0 ) return Interval<V>( std::max( roundDown( a.hi * a.hi ), V(0) ), roundUp( a.lo * a.lo ) );
+  return Interval<V>( 0, roundUp( std::max( a.lo * a.lo, a.hi * a.hi ) ) );
+}
+
+template< typename V >
+Interval<V> cos( const Interval<V>& a ) {
+  const V pi = 3.14159265358979323;
+  // Past about 1e15 the spacing of doubles is no longer small against pi, so the reduction means nothing.
+  V magnitude = std::max( std::fabs( a.lo ), std::fabs( a.hi ) );
+  if( !( a.width() < 2 * pi ) || !( magnitude < 1e15 ) ) return Interval<V>( -1, 1 );
+  V lo = std::cos( a.lo ), hi = std::cos( a.hi );
+  Interval<V> r = outward( std::min( lo, hi ), std::max( lo, hi ) );
+  // Extrema lie on multiples of pi; slack on the edges keeps rounding from hiding one.
+  V slack = 1e-12 * ( 1 + magnitude );
+  V first = std::ceil( ( a.lo - slack ) / pi ), last = std::floor( ( a.hi + slack ) / pi );
+  if( last > first ) return Interval<V>( -1, 1 );
+  if( last == first ) { if( std::fmod( first, 2 ) == 0 ) r.hi = 1; else r.lo = -1; }
+  return Interval<V>( std::max( r.lo, V(-1) ), std::min( r.hi, V(1) ) );
+}
+
+template< typename V >
+Interval<V> sin( const Interval<V>& a ) {
+  const V halfPi = 3.14159265358979323 / 2;
+  return cos( a - Interval<V>( halfPi ) );
+}
+
+template< typename V >
+Interval<V> exp( const Interval<V>& a ) { return Interval<V>( std::max( roundDown( std::exp( a.lo ) ), V(0) ), roundUp( std::exp( a.hi ) ) ); }
+
+//! Points outside the domain are ignored, so the result bounds log over the part of a where it is defined.
+template< typename V >
+Interval<V> log( const Interval<V>& a ) {
+  V lo = a.lo > 0 ? roundDown( std::log( a.lo ) ) : -std::numeric_limits<V>::infinity();
+  V hi = a.hi > 0 ? roundUp( std::log( a.hi ) ) : -std::numeric_limits<V>::infinity();
+  return Interval<V>( lo, hi );
+}
+
+template< typename V >
+Interval<V> sqrt( const Interval<V>& a ) {
+  return Interval<V>( a.lo > 0 ? roundDown( std::sqrt( a.lo ) ) : 0, a.hi > 0 ? roundUp( std::sqrt( a.hi ) ) : 0 );
+}
+
+#endif
@@ -3,12 +3,72 @@
 
 #include <bounds.h>
 #include <problem.h>
+#include <threadpool.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <string>
 
+//! A best-so-far point reported while an optimization is running.
+template <size_t Dimension, typename Value = double>
+struct Progress {
+  Vector<Dimension, Value> point;
+  Value value;
+  size_t evaluations;
+  std::chrono::nanoseconds elapsed;
+
+  //! An empty report, to be filled in by Optimization::best or wait.
+  Progress() : point(Vector<Dimension, Value>::Zero()), value(std::numeric_limits<Value>::infinity()), evaluations(0), elapsed(0) { }
+  Progress( const Vector<Dimension, Value>& p, Value v, size_t e, std::chrono::nanoseconds t ) : point(p), value(v), evaluations(e), elapsed(t) { }
+};
+
+//! Lets a running optimization stream its improvements and be stopped early, by cancellation or a deadline.
+template <size_t Dimension, typename Value = double>
+class Control {
+public:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::function<void (const Progress<Dimension, Value>&)> Callback;
+private:
+  Callback _callback;
+  Clock::time_point _start, _deadline;
+  std::atomic<bool> _cancelled;
+  Value _best;
+public:
+  Control( Callback callback = nullptr, Clock::time_point deadline = Clock::time_point::max() )
+    : _callback(callback), _start(Clock::now()), _deadline(deadline), _cancelled(false),
+      _best(std::numeric_limits<Value>::infinity()) { }
+
+  //! Asks the optimization to stop at its next check. Safe to call from any thread.
+  void cancel() { _cancelled.store(true, std::memory_order_relaxed); }
+
+  //! Checked inside the optimizers' loops; once true they return the best point they have.
+  inline bool stopped() const {
+    if (_cancelled.load(std::memory_order_relaxed)) return true;
+    return _deadline != Clock::time_point::max() && Clock::now() >= _deadline;
+  }
+
+  //! Reports a candidate point, forwarding it to the callback if it beats every earlier one.
+  void improved(const Problem<Dimension, Value>& problem, const Vector<Dimension, Value>& point, Value value) {
+    if (!(value < _best) || !problem.bounds().valid(point)) return;
+    _best = value;
+    if (_callback) _callback(Progress<Dimension, Value>(point, value, problem.fcount + problem.gcount + problem.rcount + problem.pcount, Clock::now() - _start));
+  }
+};
+
 template <size_t Dimension, typename Value = double>
 class Optimizer {
 public:
-  virtual Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem) =0;
+  //! Runs the optimization to completion.
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem) {
+    Control<Dimension, Value> control;
+    return optimize(problem, control);
+  }
+  virtual Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control) =0;
   virtual std::string getName() const = 0;
   virtual int getType() const = 0;
 };
@@ -22,16 +82,17 @@ public:
 public:
   int getType()const { return 0; }
   MultiplePointRestartAcceleratedGradientDescent( size_t count, size_t numRepetitions ) : _count(count), _numRepetitions(numRepetitions) { }
-  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem) override final {
+  using Optimizer<Dimension, Value>::optimize;
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control) override final {
     auto bestX = problem.bounds().randomPoint();
-    for (size_t i = 0; i < _count; i++) {
+    for (size_t i = 0; i < _count && !control.stopped(); i++) {
       auto x = problem.bounds().randomPoint();
       auto y = x;
       double t = 1;
       auto prevX = x;
       auto prevY = y;
       double prevT = t;
-      for (size_t i = 0; i < _numRepetitions; i++) {
+      for (size_t i = 0; i < _numRepetitions && !control.stopped(); i++) {
         prevX = x;
         prevY = y;
         prevT = t;
@@ -43,8 +104,10 @@ public:
           t = 1;
         }
       }
-      if (problem.function(x) < problem.function(bestX) && problem.bounds().valid(x)) {
+      Value fx = problem.function(x);
+      if (fx < problem.function(bestX) && problem.bounds().valid(x)) {
         bestX = x;
+        control.improved(problem, x, fx);
       }
     }
 
@@ -66,8 +129,9 @@ public:
 
     int getType()const{ return 1; }
   GradientDescent( size_t numRepetitions ) : _mpragd(1, numRepetitions) { }
-  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem) override final {
-    return _mpragd.optimize(problem);
+  using Optimizer<Dimension, Value>::optimize;
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control) override final {
+    return _mpragd.optimize(problem, control);
   }
 
   std::string getName() const {
@@ -83,21 +147,22 @@ class SimulatedAnnealing: public Optimizer<Dimension, Value> {
 public:
   int getType() const { return 2; }
   SimulatedAnnealing( double temp, double cooling, double ftemp ) : _temp(temp), _cooling(cooling), _ftemp(ftemp) { }
-  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem) override final {
+  using Optimizer<Dimension, Value>::optimize;
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control) override final {
     auto val = problem.bounds().randomPoint();
-    for( double temp = _temp; temp > _ftemp; temp *= (1 - _cooling) ) {
+    for( double temp = _temp; temp > _ftemp && !control.stopped(); temp *= (1 - _cooling) ) {
       size_t axis = randInt( Dimension );
       auto val2 = problem.bounds().randomPoint();
       for( size_t i=0; i<Dimension; i++ ) if( i != axis ) val2[i] = val[i];
       double v2 = problem.function(val2), v1 = problem.function(val);
       double tmp = exp( -(v2-v1)/temp);
-      if( tmp >= 1 ) { val = val2; continue; }
+      if( tmp >= 1 ) { val = val2; control.improved(problem, val, v2); continue; }
       double rd = randDouble();
       if(!( tmp <= 1.0 )) {
          printf("bad=%f, v2=%f v1=%f rd=%f temp=%f\n", tmp, v2, v1, rd, temp); fflush(0);
       }
       assert( tmp <= 1.0 );
-      if( rd < tmp ) { val = val2; }
+      if( rd < tmp ) { val = val2; control.improved(problem, val, v2); }
     }
     return val;
   }
@@ -143,11 +208,13 @@ class RandomGuessing: public Optimizer<Dimension, Value> {
 public:
   int getType() const { return 3; }
   RandomGuessing( size_t count ) : _count(count) { }
-  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem) override final{
+  using Optimizer<Dimension, Value>::optimize;
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control) override final{
     auto val = problem.bounds().randomPoint();
-    for(size_t i=0; i<_count-1; i++){
+    for(size_t i=0; i<_count-1 && !control.stopped(); i++){
       auto val2 = problem.bounds().randomPoint();
-      if( problem.function( val2 ) < problem.function( val ) ) val = val2;
+      Value v2 = problem.function( val2 );
+      if( v2 < problem.function( val ) ) { val = val2; control.improved(problem, val, v2); }
     }
     return val;
   }
@@ -159,4 +226,213 @@ public:
   }
 };
 
+template <size_t Dimension, typename Value = double>
+class CoordinateDescent: public Optimizer<Dimension, Value> {
+  size_t _count;
+  size_t _numSweeps;
+public:
+  int getType() const { return 5; }
+  CoordinateDescent( size_t count, size_t numSweeps ) : _count(count), _numSweeps(numSweeps) { }
+  using Optimizer<Dimension, Value>::optimize;
+  //! Steps one coordinate at a time along its partial derivative, restarting from count random points.
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control) override final {
+    auto bestX = problem.bounds().randomPoint();
+    for (size_t i = 0; i < _count && !control.stopped(); i++) {
+      auto x = problem.bounds().randomPoint();
+      for (size_t sweep = 0; sweep < _numSweeps && !control.stopped(); sweep++) {
+        for (size_t idx = 0; idx < Dimension; idx++) x[idx] -= .01 * problem.partial(x, idx);
+      }
+      Value fx = problem.function(x);
+      if (fx < problem.function(bestX) && problem.bounds().valid(x)) {
+        bestX = x;
+        control.improved(problem, x, fx);
+      }
+    }
+    return bestX;
+  }
+
+  std::string getName() const {
+    char buffer[512];
+    sprintf(buffer, "CoordinateDescent[count=%zu, numSweeps=%zu]", _count, _numSweeps);
+    return buffer;
+  }
+};
+
+template <size_t Dimension, typename Value = double>
+class StochasticGradientDescent: public Optimizer<Dimension, Value> {
+  size_t _numIterations;
+  size_t _batchSize;
+public:
+  int getType() const { return 6; }
+  StochasticGradientDescent( size_t numIterations, size_t batchSize ) : _numIterations(numIterations), _batchSize(batchSize) { }
+  using Optimizer<Dimension, Value>::optimize;
+  //! Each step follows the gradient of a random mini-batch of terms, scaled by terms/batchSize into an
+  //! unbiased estimate of the full gradient. Only the coordinates the batch touches are updated. The best
+  //! valid point is checked once per pass over the terms, so the check costs O(1) per term visited.
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control) override final {
+    auto x = problem.bounds().randomPoint();
+    auto bestX = x;
+    Value best = problem.function(x);
+    control.improved(problem, x, best);
+    size_t terms = problem.terms();
+    Value scale = .01 * terms / _batchSize;
+    size_t epoch = std::max<size_t>(1, terms / _batchSize);
+    typename Separable<Dimension, Value>::SparseGradient g;
+    Eigen::Matrix<Value, Dimension, 1> step = Eigen::Matrix<Value, Dimension, 1>::Zero();
+    std::vector<uint32_t> touched;
+    for (size_t i = 0; i < _numIterations && !control.stopped(); i++) {
+      for (size_t b = 0; b < _batchSize; b++) {
+        // A batch may be arbitrarily large, so deadlines are honoured within it; a partial batch is dropped.
+        if (control.stopped()) return bestX;
+        problem.termGradient(x, randInt(terms), g);
+        for (auto &e : g) {
+          if (step[e.first] == 0) touched.push_back(e.first);
+          step[e.first] += e.second;
+        }
+      }
+      for (auto idx : touched) { x[idx] -= scale * step[idx]; step[idx] = 0; }
+      touched.clear();
+      if ((i + 1) % epoch == 0 || i + 1 == _numIterations) {
+        Value fx = problem.function(x);
+        if (fx < best && problem.bounds().valid(x)) {
+          best = fx;
+          bestX = x;
+          control.improved(problem, x, fx);
+        }
+      }
+    }
+    return bestX;
+  }
+
+  std::string getName() const {
+    char buffer[512];
+    sprintf(buffer, "StochasticGradientDescent[numIterations=%zu, batchSize=%zu]", _numIterations, _batchSize);
+    return buffer;
+  }
+};
+
+/*
+ Best-first branch and bound over boxes of the bounds. Interval evaluation of the expression gives a
+ lower bound for each box and its midpoint an upper bound; boxes that cannot beat the incumbent by more
+ than the tolerance are pruned. When every box has been pruned the incumbent is a certified global
+ minimum to within the tolerance; the search may instead stop at maxBoxes or a deadline.
+
+ Given a pool, boxes are split and evaluated in batches across its workers and the calling thread. The
+ pool is shared, not owned, and must not be the one running the optimization itself.
+*/
+template <size_t Dimension, typename Value = double>
+class BranchAndBound: public Optimizer<Dimension, Value> {
+  Value _tolerance;
+  size_t _maxBoxes;
+  ThreadPool* _pool;
+  size_t _threads;
+
+  struct Box {
+    IntervalVector<Dimension, Value> box;
+    Value lower;
+    //! Orders the priority queue so the box with the smallest lower bound is on top.
+    bool operator<(const Box& other) const { return lower > other.lower; }
+  };
+
+  static Vector<Dimension, Value> midpoint(const IntervalVector<Dimension, Value>& box) {
+    Value vals[Dimension];
+    for (size_t i = 0; i < Dimension; i++) vals[i] = box[i].mid();
+    return Vector<Dimension, Value>(vals);
+  }
+
+  //! Fills in the lower bound and midpoint value of every box, in parallel when the batch is large enough.
+  void evaluate(const Problem<Dimension, Value>& problem, std::vector<Box>& boxes, std::vector<Value>& values) {
+    values.resize(boxes.size());
+    const Expression<Dimension, Value>& function = problem.expression();
+    auto work = [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        boxes[i].lower = function.range(boxes[i].box).lo;
+        values[i] = function(midpoint(boxes[i].box));
+      }
+    };
+
+    size_t chunks = _pool ? std::min(_threads, boxes.size() / 4) : 1;
+    if (chunks <= 1) {
+      work(0, boxes.size());
+    } else {
+      std::mutex mutex;
+      std::condition_variable finished;
+      size_t remaining = chunks - 1;
+      size_t chunk = (boxes.size() + chunks - 1) / chunks;
+      for (size_t c = 1; c < chunks; c++) {
+        _pool->submit([&, c] {
+          work(c * chunk, std::min(boxes.size(), (c + 1) * chunk));
+          std::lock_guard<std::mutex> lock(mutex);
+          if (--remaining == 0) finished.notify_one();
+        });
+      }
+      work(0, chunk);
+      std::unique_lock<std::mutex> lock(mutex);
+      finished.wait(lock, [&] { return remaining == 0; });
+    }
+    problem.rcount += boxes.size();
+    problem.fcount += boxes.size();
+  }
+
+public:
+  int getType() const { return 4; }
+  BranchAndBound( Value tolerance, size_t maxBoxes, ThreadPool* pool = nullptr )
+    : _tolerance(tolerance), _maxBoxes(maxBoxes), _pool(pool), _threads(pool ? pool->size() + 1 : 1) { }
+  using Optimizer<Dimension, Value>::optimize;
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control) override final {
+    bool certified;
+    return optimize(problem, control, certified);
+  }
+
+  //! As optimize, also telling whether the result is certified: true only if every box was pruned.
+  Vector<Dimension, Value> optimize(const Problem<Dimension, Value>&  problem, Control<Dimension, Value>& control, bool& certified) {
+    auto root = problem.bounds().box();
+    auto bestX = midpoint(root);
+    Value best = problem.function(bestX);
+    control.improved(problem, bestX, best);
+
+    std::priority_queue<Box> queue;
+    queue.push(Box{ root, problem.range(root).lo });
+    std::vector<Box> children;
+    std::vector<Value> values;
+    size_t batch = 16 * _threads;
+    bool dropped = false;
+    certified = false;
+    for (size_t boxes = 0; ; boxes += children.size()) {
+      if (queue.empty() || queue.top().lower > best - _tolerance) { certified = !dropped; break; }
+      if (boxes >= _maxBoxes || control.stopped()) break;
+      children.clear();
+      while (!queue.empty() && children.size() < batch && queue.top().lower <= best - _tolerance) {
+        Box b = queue.top();
+        queue.pop();
+        size_t axis = 0;
+        for (size_t i = 1; i < Dimension; i++) if (b.box[i].width() > b.box[axis].width()) axis = i;
+        Value mid = b.box[axis].mid();
+        // Boxes too small to split in floating point are as resolved as they will get, but leave a gap.
+        if (!(b.box[axis].lo < mid && mid < b.box[axis].hi)) { dropped = true; continue; }
+        children.push_back(b);
+        children.back().box[axis].hi = mid;
+        children.push_back(b);
+        children.back().box[axis].lo = mid;
+      }
+      evaluate(problem, children, values);
+      for (size_t i = 0; i < children.size(); i++) {
+        if (values[i] < best && problem.bounds().valid(midpoint(children[i].box))) {
+          best = values[i];
+          bestX = midpoint(children[i].box);
+          control.improved(problem, bestX, best);
+        }
+      }
+      for (auto &c : children) if (c.lower <= best - _tolerance) queue.push(c);
+    }
+    return bestX;
+  }
+
+  std::string getName() const {
+    char buffer[512];
+    sprintf(buffer, "BranchAndBound[tolerance=%g, maxBoxes=%zu, threads=%zu]", (double)_tolerance, _maxBoxes, _threads);
+    return buffer;
+  }
+};
+
 #endif
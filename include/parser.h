@@ -0,0 +1,204 @@
+#ifndef __PARSER_H_
+#define __PARSER_H_
+
+#include <cas.h>
+#include <problem.h>
+#include <cctype>
+#include <cstdlib>
+#include <istream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+ Objective language, matching the operators and functions of cas.h:
+
+   expr    := term (('+' | '-') term)*
+   term    := unary (('*' | '/') unary)*
+   unary   := '-' unary | power
+   power   := primary ('^' integer)?
+   primary := number | 'pi' | 'e' | variable | function '(' expr ')' | '(' expr ')'
+
+ Variables are x, y, z or x0, x1, ... Functions are sin, cos, exp, log, sqrt and abs.
+ An integer power is built by repeated squaring of the same node, so even powers are squares whose
+ ranges never go negative. Exponents are at most 1024 and nesting at most 256 deep.
+*/
+template< size_t L=3, typename V=double >
+class ExpressionParser {
+  //! Limits that keep hostile input from exhausting the stack or the heap.
+  static const size_t MaxDepth = 256;
+  static const unsigned long MaxExponent = 1024;
+
+  const std::string& _text;
+  size_t _pos;
+  size_t _depth;
+
+  [[noreturn]] void fail( const std::string& why ) const {
+    std::ostringstream msg;
+    msg << why << " at column " << _pos + 1 << " of \"" << _text << "\"";
+    throw std::runtime_error( msg.str() );
+  }
+  void skip() { while( _pos < _text.size() && isspace( (unsigned char)_text[_pos] ) ) _pos++; }
+  bool accept( char c ) { skip(); if( _pos < _text.size() && _text[_pos] == c ) { _pos++; return true; } return false; }
+  void expect( char c ) { if( !accept( c ) ) fail( std::string( "expected '" ) + c + "'" ); }
+
+  const Expression<L,V>& variable( size_t idx ) {
+    if( idx >= L ) fail( "variable out of range" );
+    return *(new VarExpression<L,V>(idx));
+  }
+
+  const Expression<L,V>& function( const std::string& name, const Expression<L,V>& arg ) {
+    if( name == "sin" ) return *(new EFunc<SymFunction::SIN,L,V>(arg));
+    if( name == "cos" ) return *(new EFunc<SymFunction::COS,L,V>(arg));
+    if( name == "exp" ) return *(new EFunc<SymFunction::EXP,L,V>(arg));
+    if( name == "log" ) return *(new EFunc<SymFunction::LOG,L,V>(arg));
+    if( name == "sqrt" ) return *(new EFunc<SymFunction::SQRT,L,V>(arg));
+    if( name == "abs" ) return *(new EFunc<SymFunction::SQRT,L,V>(*(new EBinop<'*',L,V>(arg, arg))));
+    fail( "unknown function " + name );
+  }
+
+  const Expression<L,V>& primary() {
+    skip();
+    if( _pos >= _text.size() ) fail( "unexpected end of expression" );
+    if( accept( '(' ) ) { auto& e = expr(); expect( ')' ); return e; }
+
+    char c = _text[_pos];
+    if( isdigit( (unsigned char)c ) || c == '.' ) {
+      const char* start = _text.c_str() + _pos;
+      char* end;
+      V val = strtod( start, &end );
+      _pos += end - start;
+      return *(new ConstExpression<L,V>(val));
+    }
+    if( !isalpha( (unsigned char)c ) ) fail( std::string( "unexpected '" ) + c + "'" );
+
+    size_t start = _pos;
+    while( _pos < _text.size() && isalnum( (unsigned char)_text[_pos] ) ) _pos++;
+    std::string name = _text.substr( start, _pos - start );
+    if( accept( '(' ) ) { auto& arg = expr(); expect( ')' ); return function( name, arg ); }
+    if( name == "pi" ) return *(new ConstExpression<L,V>(3.14159265358979323));
+    if( name == "e" ) return *(new ConstExpression<L,V>(2.7182818284590452));
+    if( name == "x" ) return variable( 0 );
+    if( name == "y" ) return variable( 1 );
+    if( name == "z" ) return variable( 2 );
+    if( name.size() > 1 && name[0] == 'x' && name.find_first_not_of( "0123456789", 1 ) == std::string::npos ) {
+      // Longer indices than L has digits cannot be in range, and would overflow the conversion.
+      if( name.size() - 1 > std::to_string( L ).size() ) fail( "variable out of range" );
+      return variable( strtoul( name.c_str() + 1, 0, 10 ) );
+    }
+    _pos = start;
+    fail( "unknown name " + name );
+  }
+
+  const Expression<L,V>& power() {
+    auto& base = primary();
+    if( !accept( '^' ) ) return base;
+    skip();
+    size_t start = _pos;
+    while( _pos < _text.size() && isdigit( (unsigned char)_text[_pos] ) ) _pos++;
+    if( start == _pos ) fail( "expected integer exponent" );
+    if( _pos - start > 4 ) fail( "exponent too large" );
+    unsigned long n = strtoul( _text.c_str() + start, 0, 10 );
+    if( n > MaxExponent ) fail( "exponent too large" );
+    if( n == 0 ) return *(new ConstExpression<L,V>(1));
+    return integerPower( base, n );
+  }
+
+  //! base^n as (base^(n/2))^2, times base when n is odd.
+  const Expression<L,V>& integerPower( const Expression<L,V>& base, unsigned long n ) {
+    if( n == 1 ) return base;
+    auto& half = integerPower( base, n / 2 );
+    auto& square = *(new EBinop<'*',L,V>(half, half));
+    if( n % 2 == 0 ) return square;
+    return *(new EBinop<'*',L,V>(square, base));
+  }
+
+  //! Every level of parentheses, function call or negation recurses through here, so nesting is bounded here.
+  const Expression<L,V>& unary() {
+    if( ++_depth > MaxDepth ) fail( "expression nested too deeply" );
+    const Expression<L,V>& e = accept( '-' ) ? *(new EFunc<SymFunction::NEG,L,V>(unary())) : power();
+    _depth--;
+    return e;
+  }
+
+  const Expression<L,V>& term() {
+    const Expression<L,V>* e = &unary();
+    for(;;) {
+      if( accept( '*' ) ) e = new EBinop<'*',L,V>(*e, unary());
+      else if( accept( '/' ) ) e = new EBinop<'/',L,V>(*e, unary());
+      else return *e;
+    }
+  }
+
+  const Expression<L,V>& expr() {
+    const Expression<L,V>* e = &term();
+    for(;;) {
+      if( accept( '+' ) ) e = new EBinop<'+',L,V>(*e, term());
+      else if( accept( '-' ) ) e = new EBinop<'-',L,V>(*e, term());
+      else return *e;
+    }
+  }
+
+public:
+  ExpressionParser( const std::string& text ) : _text(text), _pos(0), _depth(0) { }
+
+  //! Parses the whole text into an Expression graph. Like the cas.h operators, nodes are never freed.
+  const Expression<L,V>& parse() {
+    auto& e = expr();
+    skip();
+    if( _pos != _text.size() ) fail( "trailing input" );
+    return e;
+  }
+};
+
+template< size_t L, typename V=double >
+const Expression<L,V>& parseExpression( const std::string& text ) {
+  return ExpressionParser<L,V>( text ).parse();
+}
+
+/*
+ Problem files hold one problem per line, fields separated by ';':
+
+   name; optimal value; minimum bounds; maximum bounds; expression
+
+ e.g. "Sphere Function; 0; -2 -2; 2 2; x*x + y*y". Blank lines and lines starting with '#' are
+ ignored, as are problems whose bounds are not of dimension L.
+*/
+template< size_t L, typename V=double >
+std::vector<Problem<L,V>> parseProblems( std::istream& in ) {
+  std::vector<Problem<L,V>> problems;
+  std::string line;
+  for( size_t lineNo = 1; std::getline( in, line ); lineNo++ ) {
+    size_t first = line.find_first_not_of( " \t\r" );
+    if( first == std::string::npos || line[first] == '#' ) continue;
+
+    std::vector<std::string> fields;
+    std::istringstream ls( line );
+    for( std::string field; std::getline( ls, field, ';' ); ) fields.push_back( field );
+    if( fields.size() != 5 ) throw std::runtime_error( "line " + std::to_string( lineNo ) + ": expected 5 fields" );
+
+    std::vector<V> lo, hi;
+    std::istringstream los( fields[2] ), his( fields[3] );
+    for( V v; los >> v; ) lo.push_back( v );
+    for( V v; his >> v; ) hi.push_back( v );
+    if( lo.size() != hi.size() ) throw std::runtime_error( "line " + std::to_string( lineNo ) + ": bounds differ in dimension" );
+    if( lo.size() != L ) continue;
+
+    size_t nameStart = fields[0].find_first_not_of( " \t" );
+    size_t nameEnd = fields[0].find_last_not_of( " \t" );
+    std::string name = nameStart == std::string::npos ? "" : fields[0].substr( nameStart, nameEnd - nameStart + 1 );
+    const Expression<L,V>* function;
+    try { function = &parseExpression<L,V>( fields[4] ); }
+    catch( const std::runtime_error& e ) { throw std::runtime_error( "line " + std::to_string( lineNo ) + ": " + e.what() ); }
+    char* end;
+    V optimal = strtod( fields[1].c_str(), &end );
+    if( end == fields[1].c_str() || fields[1].find_first_not_of( " \t", end - fields[1].c_str() ) != std::string::npos )
+      throw std::runtime_error( "line " + std::to_string( lineNo ) + ": bad optimal value \"" + fields[1] + "\"" );
+    problems.emplace_back( name, optimal,
+                           Bounds<L,V>( Vector<L,V>( lo.data() ), Vector<L,V>( hi.data() ) ), *function );
+  }
+  return problems;
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <bounds.h>
 #include <functional>
+#include <memory>
 #include <vector.h>
 #include <cas.h>
 #include <unsupported/Eigen/AutoDiff>
@@ -12,6 +13,18 @@ template <size_t Dimension, typename Value = double>
 class Problem {
   Bounds<Dimension, Value> _bounds;
   const Expression<Dimension,Value>& _function;
+  //! Built on first use, so problems that never need per-term derivatives (or run off a mapped library)
+  //! do not pay for it; copies of a problem share it.
+  mutable std::shared_ptr<const Separable<Dimension,Value>> _separable;
+
+  const Separable<Dimension,Value> &separable() const {
+    auto s = std::atomic_load(&_separable);
+    if (!s) {
+      s = std::make_shared<const Separable<Dimension,Value>>(_function);
+      std::atomic_store(&_separable, s);
+    }
+    return *s;
+  }
 //  std::function<SquareMatrix<Dimension, Value> (Vector<Dimension, Value>)> _ihessian;
 public:
   std::string _name;
@@ -19,25 +32,35 @@ public:
   mutable size_t fcount;
   mutable size_t gcount;
   mutable size_t icount;
+  mutable size_t rcount;
+  mutable size_t pcount;
   //! Constructor for Problem class that represents an optimization problem.
   Problem( std::string name, const double optimal, const Bounds<Dimension, Value> &bounds,
           const Expression<Dimension,Value> &function
 //          const std::function<SquareMatrix<Dimension, Value> (Vector<Dimension, Value>)> &ihessian
     )
     : _name(name), _optimal(optimal), _bounds(bounds), _function(function) {
-    fcount = gcount = icount = 0;
+    fcount = gcount = icount = rcount = pcount = 0;
   }
   Problem( std::string name, const double optimal, const Bounds<Dimension, Value> &&bounds,
           const Expression<Dimension,Value> &function
 //          const std::function<SquareMatrix<Dimension, Value> (Vector<Dimension, Value>)> &ihessian
     )
     : _name(name), _optimal(optimal), _bounds(bounds), _function(function) {
-    fcount = gcount = icount = 0;
+    fcount = gcount = icount = rcount = pcount = 0;
   }
-  void reset() const { fcount = gcount = icount = 0; }
+  void reset() const { fcount = gcount = icount = rcount = pcount = 0; }
   const Bounds<Dimension,Value> &bounds() const { return _bounds; }
+  const Expression<Dimension,Value> &expression() const { return _function; }
   Value function( Vector<Dimension, Value> point ) const { fcount++; return _function(point); }
   Vector<Dimension, Value> gradient( Vector<Dimension, Value> point ) const { gcount++; return _function.grad(point); }
+  //! Number of terms the function is a sum of.
+  size_t terms() const { return separable().size(); }
+  //! The derivative in one coordinate, visiting only the terms that depend on it.
+  Value partial( const Vector<Dimension, Value>& point, size_t idx ) const { pcount++; return separable().partial(point, idx); }
+  //! The sparse gradient of a single term.
+  void termGradient( const Vector<Dimension, Value>& point, size_t term, typename Separable<Dimension, Value>::SparseGradient& out ) const { pcount++; separable().grad(point, term, out); }
+  Interval<Value> range( const IntervalVector<Dimension, Value>& box ) const { rcount++; return _function.range(box); }
 //  SquareMatrix<Dimension, Value> ihessian( Vector<Dimension, Value> point ) const { icount++; return _ihessian(point); }
 };
 
@@ -0,0 +1,222 @@
+#ifndef _SERVICE_H_
+#define _SERVICE_H_
+
+#include <optimizer.h>
+#include <threadpool.h>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ An optimizer configuration such as "sa 80 0.025 0.0005", parsed and range checked:
+
+   gd <iterations>                  random <count>
+   mpragd <count> <iterations>      bb <tolerance> <maxBoxes>
+   sa <temp> <cooling> <ftemp>      cd <count> <sweeps>
+                                    sgd <iterations> <batchSize>
+
+ Counts are positive integers, temp, ftemp and tolerance are positive and cooling lies in (0, 1), so
+ every configuration terminates. Two spellings of the same parameters compare equal.
+*/
+struct OptimizerConfig {
+  std::string kind;
+  std::vector<double> args;
+
+  bool operator<(const OptimizerConfig& other) const {
+    return kind < other.kind || (kind == other.kind && args < other.args);
+  }
+
+  OptimizerConfig( const std::string& config ) {
+    std::istringstream in(config);
+    in >> kind;
+    for (double d; in >> d; ) args.push_back(d);
+    // Counts become size_t, so they must be integers that convert without overflow.
+    const char* counts = "";
+    auto bad = [&](const char* why) { throw std::runtime_error("bad optimizer \"" + config + "\": " + why); };
+    if (!in.eof()) bad("arguments must be numbers");
+    if (kind == "gd" || kind == "random") counts = "1";
+    else if (kind == "mpragd" || kind == "cd" || kind == "sgd") counts = "11";
+    else if (kind == "sa") counts = "000";
+    else if (kind == "bb") counts = "01";
+    else bad("unknown kind");
+    if (args.size() != strlen(counts)) bad("wrong number of arguments");
+    for (size_t i = 0; i < args.size(); i++) {
+      if (!(args[i] > 0 && args[i] < 1e15)) bad("arguments must be positive and below 1e15");
+      if (counts[i] == '1' && args[i] != std::floor(args[i])) bad("counts must be integers");
+    }
+    if (kind == "sa" && !(args[1] < 1)) bad("cooling must be below 1");
+  }
+};
+
+template <size_t Dimension, typename Value = double>
+std::unique_ptr<Optimizer<Dimension, Value>> makeOptimizer(const OptimizerConfig& config) {
+  typedef std::unique_ptr<Optimizer<Dimension, Value>> Ptr;
+  auto &kind = config.kind;
+  auto &a = config.args;
+  if (kind == "gd") return Ptr(new GradientDescent<Dimension, Value>(a[0]));
+  if (kind == "mpragd") return Ptr(new MultiplePointRestartAcceleratedGradientDescent<Dimension, Value>(a[0], a[1]));
+  if (kind == "sa") return Ptr(new SimulatedAnnealing<Dimension, Value>(a[0], a[1], a[2]));
+  if (kind == "random") return Ptr(new RandomGuessing<Dimension, Value>(a[0]));
+  if (kind == "bb") return Ptr(new BranchAndBound<Dimension, Value>(a[0], a[1]));
+  if (kind == "cd") return Ptr(new CoordinateDescent<Dimension, Value>(a[0], a[1]));
+  return Ptr(new StochasticGradientDescent<Dimension, Value>(a[0], a[1]));
+}
+
+/*
+ Solves a stream of independent jobs on a fixed pool of workers. Each input line is one job:
+
+   id; problem; seed; optimizer config
+
+ where problem is a problem name or index. Every job is answered with one line, in order of completion:
+
+   id; value; x0 x1 ...; evaluations; microseconds
+   id; error; message
+
+ Jobs are handed to the workers in batches to amortize dispatch: a batch closes when it is full or when
+ no more input is buffered. Each job runs under its own deadline and gives the best point it had then;
+ its line is written as soon as it finishes. Each worker keeps its own copy of every problem it has solved, so the
+ evaluation counters are never shared, and reseeds its own random engine for each job.
+*/
+template <size_t Dimension, typename Value = double>
+class SolverService {
+  struct Job {
+    std::string id;
+    const Problem<Dimension, Value>* problem;
+    std::shared_ptr<Optimizer<Dimension, Value>> optimizer;
+    uint64_t seed;
+  };
+
+  const std::vector<Problem<Dimension, Value>>& _problems;
+  //! Most distinct optimizer configurations kept built at once.
+  static const size_t MaxOptimizers = 256;
+
+  std::map<OptimizerConfig, std::shared_ptr<Optimizer<Dimension, Value>>> _optimizers;
+  size_t _batchSize;
+  std::chrono::milliseconds _timeout;
+  FILE* _out;
+  std::mutex _mutex;
+  std::condition_variable _idle;
+  size_t _pending;
+  ThreadPool _pool;
+
+  static std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+    return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+  }
+
+  void write(const std::string& text) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    fwrite(text.data(), 1, text.size(), _out);
+    fflush(_out);
+  }
+
+  //! Fills in job from an input line. Optimizers are built once per distinct configuration and shared;
+  //! running jobs hold their own reference, so an evicted optimizer lives until its jobs finish.
+  void parse(const std::string& line, Job& job) {
+    std::vector<std::string> fields;
+    std::istringstream ls(line);
+    for (std::string field; std::getline(ls, field, ';'); ) fields.push_back(trim(field));
+    if (fields.empty()) throw std::runtime_error("empty job");
+    job.id = fields[0];
+    if (fields.size() != 4) throw std::runtime_error("expected 4 fields");
+
+    job.problem = 0;
+    char* end;
+    size_t idx = strtoul(fields[1].c_str(), &end, 10);
+    if (*end == 0 && !fields[1].empty() && idx < _problems.size()) job.problem = &_problems[idx];
+    for (auto &p : _problems) if (!job.problem && p._name == fields[1]) job.problem = &p;
+    if (!job.problem) throw std::runtime_error("unknown problem " + fields[1]);
+
+    job.seed = strtoull(fields[2].c_str(), &end, 10);
+    if (*end != 0 || fields[2].empty()) throw std::runtime_error("bad seed " + fields[2]);
+
+    OptimizerConfig config(fields[3]);
+    auto it = _optimizers.find(config);
+    if (it == _optimizers.end()) {
+      if (_optimizers.size() >= MaxOptimizers) _optimizers.erase(_optimizers.begin());
+      it = _optimizers.emplace(config, std::shared_ptr<Optimizer<Dimension, Value>>(makeOptimizer<Dimension, Value>(config))).first;
+    }
+    job.optimizer = it->second;
+  }
+
+  void run(const std::vector<Job>& batch) {
+    thread_local std::unordered_map<const Problem<Dimension, Value>*, Problem<Dimension, Value>> copies;
+    std::string out;
+    char buffer[64];
+    for (auto &job : batch) {
+      out.clear();
+      auto it = copies.find(job.problem);
+      if (it == copies.end()) it = copies.emplace(job.problem, *job.problem).first;
+      auto &problem = it->second;
+
+      seedRandom(job.seed);
+      problem.reset();
+      auto begin = std::chrono::steady_clock::now();
+      Control<Dimension, Value> control(nullptr, begin + _timeout);
+      auto x = job.optimizer->optimize(problem, control);
+      auto end = std::chrono::steady_clock::now();
+      size_t evaluations = problem.fcount + problem.gcount + problem.rcount + problem.pcount;
+
+      out += job.id;
+      snprintf(buffer, sizeof(buffer), "; %.17g;", (double)problem.function(x));
+      out += buffer;
+      for (size_t i = 0; i < Dimension; i++) { snprintf(buffer, sizeof(buffer), " %.17g", (double)x[i]); out += buffer; }
+      snprintf(buffer, sizeof(buffer), "; %zu; %lld\n", evaluations,
+               (long long)std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count());
+      out += buffer;
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      fwrite(out.data(), 1, out.size(), _out);
+      fflush(_out);
+      if (--_pending == 0) _idle.notify_all();
+    }
+  }
+
+  void dispatch(std::vector<Job>& batch) {
+    if (batch.empty()) return;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _pending += batch.size();
+    }
+    auto jobs = std::make_shared<std::vector<Job>>(std::move(batch));
+    batch.clear();
+    _pool.submit([this, jobs] { run(*jobs); });
+  }
+
+public:
+  SolverService( const std::vector<Problem<Dimension, Value>>& problems, size_t workers, size_t batchSize,
+                 std::chrono::milliseconds timeout, FILE* out = stdout )
+    : _problems(problems), _batchSize(batchSize ? batchSize : 1), _timeout(timeout), _out(out), _pending(0), _pool(workers) { }
+
+  //! Answers every job read from in, returning once the input has ended and all jobs are answered.
+  void serve(std::istream& in) {
+    std::vector<Job> batch;
+    for (std::string line; std::getline(in, line); ) {
+      if (trim(line).empty()) continue;
+      Job job;
+      try {
+        parse(line, job);
+        batch.push_back(job);
+      } catch (const std::runtime_error& e) {
+        write(job.id + "; error; " + e.what() + "\n");
+      }
+      if (batch.size() >= _batchSize || in.rdbuf()->in_avail() <= 0) dispatch(batch);
+    }
+    dispatch(batch);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _pending == 0; });
+  }
+};
+
+#endif
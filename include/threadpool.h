@@ -0,0 +1,62 @@
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! A fixed set of worker threads running submitted tasks in order of submission.
+class ThreadPool {
+  std::vector<std::thread> _workers;
+  std::deque<std::function<void ()>> _tasks;
+  std::mutex _mutex;
+  std::condition_variable _ready;
+  bool _stopping;
+
+  void work() {
+    for (;;) {
+      std::function<void ()> task;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+        if (_tasks.empty()) return;
+        task = std::move(_tasks.front());
+        _tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+public:
+  ThreadPool( size_t count = std::thread::hardware_concurrency() ) : _stopping(false) {
+    if (count == 0) count = 1;
+    for (size_t i = 0; i < count; i++) _workers.emplace_back([this] { work(); });
+  }
+  ThreadPool( const ThreadPool& ) = delete;
+  ThreadPool& operator=( const ThreadPool& ) = delete;
+
+  //! Runs every task already submitted, then joins the workers.
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _ready.notify_all();
+    for (auto &w : _workers) w.join();
+  }
+
+  size_t size() const { return _workers.size(); }
+
+  void submit( std::function<void ()> task ) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _tasks.push_back(std::move(task));
+    }
+    _ready.notify_one();
+  }
+};
+
+#endif
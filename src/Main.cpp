@@ -2,10 +2,18 @@
 #include <vector>
 #include <algorithm>
 
+#include <cctype>
+#include <cerrno>
 #include <chrono>
 
 #include <problem.h>
 #include <optimizer.h>
+#include <parser.h>
+#include <compiled.h>
+#include <service.h>
+#include <async.h>
+#include <fstream>
+#include <memory>
 
 using namespace std;
 
@@ -18,7 +26,7 @@ template <size_t Dimension, typename Value = double>
 void run_opts(int idx, const Problem<Dimension, Value> &problem) {
 
   // The optimization methods.
-  Optimizer<Dimension, Value> *opts[8 + 16 + 7*7*7] = { 0 };
+  Optimizer<Dimension, Value> *opts[8 + 16 + 7*7*7 + 4 + 8] = { 0 };
 
   for( int i=0; i<4; i++) opts[0+i] = new GradientDescent<Dimension, Value>(100*(2<<i));
 
@@ -33,6 +41,12 @@ opts[8+4*i+j] = new MultiplePointRestartAcceleratedGradientDescent<Dimension, Va
   for( int k=0; k<7; k++)
 opts[16+8+7*7*i+7*j+k] = new SimulatedAnnealing<Dimension, Value>(10*(2<<i), .1/(2<<j), .001/(2<<k) );
 
+  for( int i=0; i<4; i++) opts[16+8+7*7*7+i] = new BranchAndBound<Dimension, Value>(pow(.1, 2+i), 100000);
+
+  for( int i=0; i<4; i++) opts[16+8+7*7*7+4+i] = new CoordinateDescent<Dimension, Value>(1, 100*(2<<i));
+
+  for( int i=0; i<4; i++) opts[16+8+7*7*7+8+i] = new StochasticGradientDescent<Dimension, Value>(100*(2<<i), 2);
+
   // Performs each optimization in the listed optimization methods.
   for (auto &opt : opts) {
   //printf("%s %s:\n", problem._name.c_str(), opt->getName().c_str() );
@@ -86,11 +100,180 @@ In[58]:= outputC[D[out, {{x, y, z}, 2}]]
 Out[58]= "{{2, 0, 0}, {0, 6, 0}, {0, 0, 6}}"
 */
 
+//! Loads the problems of a text problem file or a binary problem library.
+template <size_t Dimension, typename Value = double>
+std::vector<Problem<Dimension, Value>> load_problems(const std::string &path, std::unique_ptr<ProblemLibrary<Dimension, Value>> &library) {
+  if (isProblemLibrary(path)) {
+    library.reset(new ProblemLibrary<Dimension, Value>(path));
+    return library->problems();
+  }
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("cannot open " + path);
+  return parseProblems<Dimension, Value>(in);
+}
+
+//! Races a few optimizers on every problem on a fixed pool, all finished by the deadline. Runs hold a
+//! worker until they stop, so they go in waves of one per worker, each wave given an equal share of the time.
+template <size_t Dimension, typename Value = double>
+void run_deadline(const std::vector<Problem<Dimension, Value>> &problems, long milliseconds) {
+  SimulatedAnnealing<Dimension, Value> sa(1e6, 1e-6, 1e-9);
+  MultiplePointRestartAcceleratedGradientDescent<Dimension, Value> mpragd(1000000, 200);
+  BranchAndBound<Dimension, Value> bb(1e-9, (size_t)-1);
+  Optimizer<Dimension, Value> *opts[] = { &sa, &mpragd, &bb };
+
+  ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+  size_t waves = (problems.size() * 3 + pool.size() - 1) / pool.size();
+  auto start = std::chrono::steady_clock::now();
+  auto slice = std::chrono::milliseconds(milliseconds) / std::max<size_t>(waves, 1);
+  std::vector<std::shared_ptr<Optimization<Dimension, Value>>> runs;
+  for (auto &p : problems)
+    for (auto opt : opts) {
+      auto deadline = start + slice * (runs.size() / pool.size() + 1);
+      runs.push_back(optimizeAsync(pool, *opt, p, randomSeed(), nullptr, deadline));
+    }
+
+  for (size_t i = 0; i < runs.size(); i++) {
+    Progress<Dimension, Value> best;
+    const char *name = problems[i / 3]._name.c_str();
+    if (!runs[i]->wait(best)) { printf("%s %s: no point found\n", name, opts[i % 3]->getName().c_str()); continue; }
+    printf("%s %s: % .7f after %zu evaluations, %lld us\n", name, opts[i % 3]->getName().c_str(), best.value,
+           best.evaluations, (long long)std::chrono::duration_cast<std::chrono::microseconds>(best.elapsed).count());
+  }
+}
+
+//! Checks and times the per-term derivatives on chained sums of Dimension variables, where a term touches
+//! at most two variables: the term-by-term gradient must match the whole-expression one, and costs O(n)
+//! against the O(n^2) of dense gradient vectors. Coordinate and stochastic descent then run on a chained
+//! quadratic that their fixed steps can converge on.
+template <size_t Dimension, typename Value = double>
+void run_separable() {
+  std::string rosenbrock, quadratic;
+  for (size_t i = 0; i + 1 < Dimension; i++) {
+    std::string x = "x" + std::to_string(i), next = "x" + std::to_string(i + 1);
+    rosenbrock += (i ? " + 100*(" : "100*(") + next + " - " + x + "^2)^2 + (1 - " + x + ")^2";
+    quadratic += (i ? " + (" : "(") + x + " - 1)^2 + (" + next + " - " + x + ")^2";
+  }
+  quadratic += " + (x" + std::to_string(Dimension - 1) + " - 1)^2";
+  std::vector<Value> lo(Dimension, -2), hi(Dimension, 2);
+  Bounds<Dimension, Value> bounds(Vector<Dimension, Value>(lo.data()), Vector<Dimension, Value>(hi.data()));
+  Problem<Dimension, Value> problems[] = {
+    { "Chained Rosenbrock", 0, bounds, parseExpression<Dimension, Value>(rosenbrock) },
+    { "Chained Quadratic", 0, bounds, parseExpression<Dimension, Value>(quadratic) },
+  };
+
+  seedRandom(1);
+  for (auto &p : problems) {
+    const size_t NUM = 20;
+    double error = 0, dense = 0, sparse = 0, partials = 0;
+    typename Separable<Dimension, Value>::SparseGradient g;
+    for (size_t n = 0; n < NUM; n++) {
+      auto x = p.bounds().randomPoint();
+      auto begin = std::chrono::high_resolution_clock::now();
+      auto full = p.gradient(x);
+      auto mid = std::chrono::high_resolution_clock::now();
+      Vector<Dimension, Value> sum = Vector<Dimension, Value>::Zero();
+      for (size_t t = 0; t < p.terms(); t++) {
+        p.termGradient(x, t, g);
+        for (auto &e : g) sum[e.first] += e.second;
+      }
+      auto end = std::chrono::high_resolution_clock::now();
+      Vector<Dimension, Value> coordinates = Vector<Dimension, Value>::Zero();
+      for (size_t idx = 0; idx < Dimension; idx++) coordinates[idx] = p.partial(x, idx);
+      auto last = std::chrono::high_resolution_clock::now();
+      dense += std::chrono::duration_cast<std::chrono::nanoseconds>(mid - begin).count();
+      sparse += std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count();
+      partials += std::chrono::duration_cast<std::chrono::nanoseconds>(last - end).count();
+      error = std::max(error, (double)((sum - full).cwiseAbs().maxCoeff() / (1 + full.cwiseAbs().maxCoeff())));
+      error = std::max(error, (double)((coordinates - full).cwiseAbs().maxCoeff() / (1 + full.cwiseAbs().maxCoeff())));
+    }
+    printf("%s, %zu variables, %zu terms: gradient %.0f us, by terms %.0f us, by partials %.0f us, relative error %g\n",
+           p._name.c_str(), Dimension, p.terms(), dense / NUM / 1000, sparse / NUM / 1000, partials / NUM / 1000, error);
+  }
+
+  auto &p = problems[1];
+  GradientDescent<Dimension, Value> gd(50);
+  CoordinateDescent<Dimension, Value> cd(1, 1000);
+  StochasticGradientDescent<Dimension, Value> sgd(50 * p.terms() / 32, 32);
+  Optimizer<Dimension, Value> *opts[] = { &gd, &cd, &sgd };
+  for (auto opt : opts) {
+    seedRandom(1);
+    p.reset();
+    auto begin = std::chrono::high_resolution_clock::now();
+    auto solution = opt->optimize(p);
+    auto end = std::chrono::high_resolution_clock::now();
+    size_t f = p.fcount, g = p.gcount, d = p.pcount;
+    printf("%s %s: f %.3g after %zu functions, %zu gradients, %zu partial/term gradients, %.0f us\n", p._name.c_str(),
+           opt->getName().c_str(), (double)p.function(solution), f, g, d,
+           std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count() / 1000.);
+  }
+}
+
+//! Parses a command line count in [1, max], returning 0 if arg is anything else.
+static size_t parse_count(const char *arg, size_t max) {
+  if (!isdigit((unsigned char)arg[0])) return 0;
+  errno = 0;
+  char *end;
+  unsigned long long value = strtoull(arg, &end, 10);
+  if (*end != 0 || errno == ERANGE || value > max) return 0;
+  return value;
+}
+
 int main (int argc, char** argv) {
   // Testing setup.
   #define test_dimension 2
   #define test_value double
 
+  // optimizer --compile <problems.txt> <library.bin>: compiles a problem file into a binary library.
+  // optimizer --serve <problems.txt | library.bin> [workers] [batch] [timeout ms]: solves jobs read from stdin (see service.h).
+  // optimizer --deadline <milliseconds> <problems.txt | library.bin>: best points each optimizer reaches by a deadline.
+  // optimizer --separable: checks and times term-by-term gradients and coordinate/stochastic descent on 400 variables.
+  // optimizer <problems.txt | library.bin>: runs the optimizations on the problems of a file.
+  if (argc > 1) {
+    try {
+      if (std::string(argv[1]) == "--serve") {
+        size_t workers = argc > 3 ? parse_count(argv[3], 1024) : std::max(1u, std::thread::hardware_concurrency());
+        size_t batch = argc > 4 ? parse_count(argv[4], 1 << 20) : 16;
+        size_t timeout = argc > 5 ? parse_count(argv[5], 7 * 24 * 3600 * 1000) : 10000;
+        if (argc < 3 || argc > 6 || !workers || !batch || !timeout) {
+          fprintf(stderr, "usage: %s --serve <problems> [workers (1-1024)] [batch (1-1048576)] [timeout ms (1-604800000)]\n", argv[0]);
+          return 1;
+        }
+        std::unique_ptr<ProblemLibrary<test_dimension, test_value>> library;
+        auto problems = load_problems<test_dimension, test_value>(argv[2], library);
+        std::ios::sync_with_stdio(false);
+        SolverService<test_dimension, test_value>(problems, workers, batch, std::chrono::milliseconds(timeout)).serve(std::cin);
+        return 0;
+      }
+      if (std::string(argv[1]) == "--deadline") {
+        if (argc != 4) { fprintf(stderr, "usage: %s --deadline <milliseconds> <problems>\n", argv[0]); return 1; }
+        std::unique_ptr<ProblemLibrary<test_dimension, test_value>> library;
+        run_deadline(load_problems<test_dimension, test_value>(argv[3], library), atol(argv[2]));
+        return 0;
+      }
+      if (std::string(argv[1]) == "--separable") {
+        run_separable<400, test_value>();
+        return 0;
+      }
+      if (std::string(argv[1]) == "--compile") {
+        if (argc != 4) { fprintf(stderr, "usage: %s --compile <problems.txt> <library.bin>\n", argv[0]); return 1; }
+        std::ifstream in(argv[2]);
+        if (!in) throw std::runtime_error(std::string("cannot open ") + argv[2]);
+        writeProblemLibrary(argv[3], parseProblems<test_dimension, test_value>(in));
+        return 0;
+      }
+      std::unique_ptr<ProblemLibrary<test_dimension, test_value>> library;
+      auto problems = load_problems<test_dimension, test_value>(argv[1], library);
+      int i=0;
+      for (auto &p : problems) {
+        run_opts(i, p);i++;
+      }
+    } catch (const std::runtime_error &e) {
+      fprintf(stderr, "%s\n", e.what());
+      return 1;
+    }
+    return 0;
+  }
+
   VarExpression<2> x2(0);
   VarExpression<2> y2(1);
 
@@ -113,5 +296,6 @@ int main (int argc, char** argv) {
   for (auto &p : problems) {
     run_opts(i, p);i++;
   }
+  run_separable<400, test_value>();
   return 0;
 }